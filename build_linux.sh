@@ -4,6 +4,7 @@ set -x
 CLEAN_BUILD=NO
 BUILD_TEST=false
 EXAMPLE_NAME=""
+TEST_ARGS=""
 # parse command line args
 # https://stackoverflow.com/a/14203146/12003165
 for i in "$@"; do
@@ -17,6 +18,9 @@ for i in "$@"; do
     -e=*|--example=*)
       EXAMPLE_NAME="${i#*=}"
       ;;
+    -a=*|--arch=*)
+      TEST_ARGS="--arch=${i#*=}"
+      ;;
     -*|--*)
       echo "Unknown option $i"
       exit 1
@@ -41,7 +45,7 @@ if [ $? -eq 0 ]; then
   # Run tests
   if [ "${BUILD_TEST}" = "true" ]; then
     echo "Running tests"
-    ./tests
+    ./tests ${TEST_ARGS}
   else # Run examples
     if [ "${EXAMPLE_NAME}" = "" ]; then
         EXAMPLE_NAME="body_minimal"
@@ -0,0 +1,82 @@
+// #include "common.h"
+// #include "particle_readback.h"
+#include <algorithm>
+#include <cmath>
+
+// Chooses the sub-step time step of a world from the CFL condition before
+// every step. The sub-step time step is set to the largest value that keeps
+// particles from travelling more than `cfl` grid cells per sub-step, clamped to
+// `[min_substep_dt, max_substep_dt]`.
+//
+// The particle velocities are read back without waiting through a
+// `LaggedParticleReadback`, so the speed used for a step is two frames old.
+// `cfl` should leave room for particles accelerating in between; the default is
+// half of the usual 0.5. Until a complete read-back is available, and whenever
+// the world outgrew the copied particles, `min_substep_dt` is used.
+struct AdaptiveSubstepper {
+  S2World world;
+  TiRuntime runtime;
+  float min_substep_dt{1e-5f};
+  float max_substep_dt{1e-3f};
+  float cfl{0.25f};
+
+  uint32_t last_substep_num_{0};
+  float last_substep_dt_{0.0f};
+  // The world's own sub-step time step, used if the bounds are not positive.
+  float fallback_substep_dt_{1e-4f};
+  LaggedParticleReadback readback_{};
+
+  AdaptiveSubstepper(){};
+  AdaptiveSubstepper(S2World world, TiRuntime runtime, float min_substep_dt,
+                     float max_substep_dt)
+      : world(world), runtime(runtime), min_substep_dt(min_substep_dt),
+        max_substep_dt(max_substep_dt),
+        fallback_substep_dt_(s2_get_world_config(world).substep_dt),
+        readback_(runtime, world, {S2_BUFFER_NAME_PARTICLE_VELOCITY},
+                  {sizeof(S2Vec2)}) {}
+
+  void SetCfl(float cfl) { this->cfl = cfl; }
+
+  // Advance the world by `delta_time` and return the number of sub-steps used.
+  // Should be called once per frame, before the frame's commands are flushed.
+  uint32_t Step(float delta_time) {
+    float substep_dt = ComputeSubstepTimestep();
+    if (!(substep_dt > 0.0f)) {
+      substep_dt = fallback_substep_dt_;
+    }
+    s2_set_substep_timestep(world, substep_dt);
+    s2_step(world, delta_time);
+    readback_.Update();
+    last_substep_dt_ = substep_dt;
+    last_substep_num_ = (uint32_t)std::ceil(delta_time / substep_dt);
+    return last_substep_num_;
+  }
+
+  uint32_t GetLastSubstepNum() const { return last_substep_num_; }
+
+  float GetLastSubstepTimestep() const { return last_substep_dt_; }
+
+  void Destroy() { readback_.Destroy(); }
+
+  float ComputeSubstepTimestep() {
+    if (!readback_.IsValid() ||
+        readback_.GetAvailableNum() < readback_.GetParticleNum()) {
+      return min_substep_dt;
+    }
+    const S2Vec2 *velocities = (const S2Vec2 *)readback_.GetData(0);
+    float max_speed_sqr = 0.0f;
+    for (uint32_t i = 0; i < readback_.GetAvailableNum(); ++i) {
+      const S2Vec2 &v = velocities[i];
+      max_speed_sqr = std::max(max_speed_sqr, v.x * v.x + v.y * v.y);
+    }
+    if (max_speed_sqr == 0.0f) {
+      return max_substep_dt;
+    }
+
+    S2WorldConfig config = s2_get_world_config(world);
+    S2Vec2I grid_resolution = s2_get_world_grid_resolution(world);
+    float dx = config.extent.x / grid_resolution.x;
+    float substep_dt = cfl * dx / std::sqrt(max_speed_sqr);
+    return std::clamp(substep_dt, min_substep_dt, max_substep_dt);
+  }
+};
@@ -0,0 +1,108 @@
+// #include "common.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// A completion handle of a step submitted by `AsyncStepper::StepAsync()`.
+// Tokens increase monotonically, so a token is complete once any later token
+// is complete.
+typedef uint64_t StepToken;
+
+// Submits steps without waiting and tracks their completion on the host.
+//
+// After every submitted step, the step's token is copied on the device from a
+// host-writable ring of token values into a host-visible signal buffer. The
+// copy is ordered after the step's kernels, so `Poll()` can map the signal
+// buffer and compare instead of waiting for the device to go idle.
+struct AsyncStepper {
+  // The number of token slots in the ring, i.e. the maximum number of steps in
+  // flight. Submitting more waits for the oldest one to finish.
+  static constexpr uint32_t kTokenSlotNum = 64;
+
+  TiRuntime runtime{TI_NULL_HANDLE};
+  TiMemory token_ring_{TI_NULL_HANDLE};
+  TiMemory token_signal_{TI_NULL_HANDLE};
+  StepToken submitted_{0};
+  StepToken completed_{0};
+
+  AsyncStepper(){};
+  AsyncStepper(TiRuntime runtime) : runtime(runtime) {
+    TiMemoryAllocateInfo mai{};
+    mai.size = sizeof(StepToken) * kTokenSlotNum;
+    mai.host_write = TI_TRUE;
+    mai.usage = TI_MEMORY_USAGE_STORAGE_BIT;
+    token_ring_ = ti_allocate_memory(runtime, &mai);
+
+    mai.size = sizeof(StepToken);
+    mai.host_read = TI_TRUE;
+    token_signal_ = ti_allocate_memory(runtime, &mai);
+    void *mapped = ti_map_memory(runtime, token_signal_);
+    std::memset(mapped, 0, sizeof(StepToken));
+    ti_unmap_memory(runtime, token_signal_);
+  }
+
+  // Record the sub-steps of `s2_step()` and submit them to the device without
+  // waiting. Commands recorded on the same runtime afterwards, such as buffer
+  // copies, are ordered after the step.
+  StepToken StepAsync(S2World world, float delta_time) {
+    s2_step(world, delta_time);
+    return Submit();
+  }
+
+  // Return true if the step of `token` has finished on the device. Never
+  // blocks.
+  bool Poll(StepToken token) {
+    if (token > completed_) {
+      StepToken signaled = 0;
+      void *mapped = ti_map_memory(runtime, token_signal_);
+      std::memcpy(&signaled, mapped, sizeof(signaled));
+      ti_unmap_memory(runtime, token_signal_);
+      completed_ = std::max(completed_, signaled);
+    }
+    return token <= completed_;
+  }
+
+  // Block until the step of `token` has finished. Host reads of soft2d
+  // buffers are safe after this call returns.
+  void Wait(StepToken token) {
+    if (token > completed_) {
+      ti_wait(runtime);
+      completed_ = submitted_;
+    }
+  }
+
+  void Destroy() {
+    ti_wait(runtime);
+    ti_free_memory(runtime, token_ring_);
+    ti_free_memory(runtime, token_signal_);
+    token_ring_ = TI_NULL_HANDLE;
+    token_signal_ = TI_NULL_HANDLE;
+  }
+
+  // Record the signal copy of a new token and flush. The ring slot of the new
+  // token is reused from `kTokenSlotNum` tokens ago, and its copy must have
+  // been executed before the slot is overwritten.
+  StepToken Submit() {
+    StepToken token = submitted_ + 1;
+    if (token > kTokenSlotNum && !Poll(token - kTokenSlotNum)) {
+      Wait(token - kTokenSlotNum);
+    }
+    uint32_t slot = token % kTokenSlotNum;
+    uint8_t *mapped = (uint8_t *)ti_map_memory(runtime, token_ring_);
+    std::memcpy(mapped + sizeof(StepToken) * slot, &token, sizeof(token));
+    ti_unmap_memory(runtime, token_ring_);
+
+    TiMemorySlice src;
+    src.memory = token_ring_;
+    src.offset = sizeof(StepToken) * slot;
+    src.size = sizeof(StepToken);
+    TiMemorySlice dst;
+    dst.memory = token_signal_;
+    dst.offset = 0;
+    dst.size = sizeof(StepToken);
+    ti_copy_memory_device_to_device(runtime, &dst, &src);
+    ti_flush(runtime);
+    submitted_ = token;
+    return token;
+  }
+};
@@ -1,3 +1,4 @@
+#include <cstring>
 #include <soft2d/soft2d.h>
 #include <taichi/taichi.h>
 #include <vector>
@@ -204,3 +205,98 @@ inline void ndarray_data_copy(const TiRuntime &runtime,
   dst.size = size_in_bytes;
   ti_copy_memory_device_to_device(runtime, &dst, &src);
 }
+
+// Copy the positions of the first `particle_num` particles of a world. Live
+// particles are always packed at the beginning of soft2d's particle buffers,
+// so this moves only the live prefix instead of the whole capacity.
+inline void copy_live_particle_positions(const TiRuntime &runtime,
+                                         const TiNdArray &dst_arr,
+                                         S2World world,
+                                         uint32_t particle_num) {
+  if (particle_num == 0) {
+    return;
+  }
+  TiNdArray particle_x;
+  s2_get_buffer(world, S2_BUFFER_NAME_PARTICLE_POSITION, &particle_x);
+  ndarray_data_copy(runtime, dst_arr, particle_x,
+                    sizeof(float) * 2 * particle_num);
+}
+
+// Read `size_in_bytes` bytes at the beginning of a device buffer back to host
+// memory. This waits until all device commands submitted before have finished.
+inline void ndarray_data_read(const TiRuntime &runtime,
+                              const TiNdArray &src_arr, void *dst,
+                              size_t size_in_bytes) {
+  TiMemoryAllocateInfo mai{};
+  mai.size = size_in_bytes;
+  mai.host_read = TI_TRUE;
+  mai.usage = TI_MEMORY_USAGE_STORAGE_BIT;
+  TiMemory read_back_memory = ti_allocate_memory(runtime, &mai);
+
+  TiMemorySlice src;
+  src.memory = src_arr.memory;
+  src.offset = 0;
+  src.size = size_in_bytes;
+  TiMemorySlice dst_slice;
+  dst_slice.memory = read_back_memory;
+  dst_slice.offset = 0;
+  dst_slice.size = size_in_bytes;
+  ti_copy_memory_device_to_device(runtime, &dst_slice, &src);
+  ti_flush(runtime);
+  ti_wait(runtime);
+
+  void *mapped = ti_map_memory(runtime, read_back_memory);
+  std::memcpy(dst, mapped, size_in_bytes);
+  ti_unmap_memory(runtime, read_back_memory);
+  ti_free_memory(runtime, read_back_memory);
+}
+
+// Write `size_in_bytes` bytes of host memory to the beginning of a device
+// buffer. The upload is recorded as a device command and is ordered before any
+// command recorded afterwards.
+inline void ndarray_data_write(const TiRuntime &runtime,
+                               const TiNdArray &dst_arr, const void *src,
+                               size_t size_in_bytes) {
+  TiMemoryAllocateInfo mai{};
+  mai.size = size_in_bytes;
+  mai.host_write = TI_TRUE;
+  mai.usage = TI_MEMORY_USAGE_STORAGE_BIT;
+  TiMemory staging_memory = ti_allocate_memory(runtime, &mai);
+
+  void *mapped = ti_map_memory(runtime, staging_memory);
+  std::memcpy(mapped, src, size_in_bytes);
+  ti_unmap_memory(runtime, staging_memory);
+
+  TiMemorySlice src_slice;
+  src_slice.memory = staging_memory;
+  src_slice.offset = 0;
+  src_slice.size = size_in_bytes;
+  TiMemorySlice dst;
+  dst.memory = dst_arr.memory;
+  dst.offset = 0;
+  dst.size = size_in_bytes;
+  ti_copy_memory_device_to_device(runtime, &dst, &src_slice);
+  ti_flush(runtime);
+  ti_wait(runtime);
+  ti_free_memory(runtime, staging_memory);
+}
+
+// Decode the raw bits read from `S2_BUFFER_NAME_PARTICLE_NUM`, whose element
+// type is either int or float.
+inline uint32_t decode_particle_num(TiDataType elem_type, uint32_t raw) {
+  if (elem_type == TI_DATA_TYPE_F32) {
+    float value;
+    std::memcpy(&value, &raw, sizeof(value));
+    return (uint32_t)value;
+  }
+  return raw;
+}
+
+// Read the current number of particles in a world back to the host.
+inline uint32_t read_particle_num(const TiRuntime &runtime, S2World world) {
+  TiNdArray particle_num;
+  s2_get_buffer(world, S2_BUFFER_NAME_PARTICLE_NUM, &particle_num);
+  uint32_t raw = 0;
+  ndarray_data_read(runtime, particle_num, &raw, sizeof(raw));
+  return decode_particle_num(particle_num.elem_type, raw);
+}
@@ -6,6 +6,8 @@
 #include "globals.h"
 #include "taichi/aot_demo/framework.hpp"
 #include "emitter.h"
+#include "particle_counter.h"
+#include <algorithm>
 // clang-format on
 
 using namespace ti::aot_demo;
@@ -17,6 +19,8 @@ struct Emitters : public App {
 
   S2World world;
   Emitter emitter;
+  ParticleCounter particle_counter;
+  uint32_t copied_particle_num = 0;
 
   std::unique_ptr<GraphicsTask> draw_points;
   std::unique_ptr<GraphicsTask> draw_collider_texture;
@@ -55,6 +59,7 @@ struct Emitters : public App {
     kinematics.mobility = S2Mobility::S2_MOBILITY_DYNAMIC;
 
     emitter = Emitter(world, material, kinematics, shape);
+    particle_counter = ParticleCounter(runtime.runtime(), world);
 
     // Add the boundary
     // bottom
@@ -99,12 +104,14 @@ struct Emitters : public App {
     emitter.Update(frame);
     s2_step(world, 0.004);
 
-    // Export particle position data to the external buffer
-    TiNdArray particle_x;
-    s2_get_buffer(world, S2_BUFFER_NAME_PARTICLE_POSITION, &particle_x);
-    ndarray_data_copy(runtime.runtime(), x_.ndarray(), particle_x,
-                      sizeof(float) * 2 *
-                          s2_get_world_config(world).max_allowed_particle_num);
+    // Export particle position data to the external buffer. Only the live
+    // particles are copied. The count lags by two frames, and the previous
+    // count is also covered so slots freed in the last frame are overwritten.
+    particle_counter.Update();
+    uint32_t particle_num = particle_counter.Get();
+    copy_live_particle_positions(runtime.runtime(), x_.ndarray(), world,
+                                 std::max(particle_num, copied_particle_num));
+    copied_particle_num = particle_num;
 
     // Export collider buffer to texture
     auto texture = collider_texture_.texture();
@@ -124,6 +131,7 @@ struct Emitters : public App {
     renderer.enqueue_graphics_task(*draw_points);
     renderer.enqueue_graphics_task(*draw_collider_texture);
   }
+  virtual ~Emitters() { particle_counter.Destroy(); }
 };
 
 std::unique_ptr<App> create_app() { return std::unique_ptr<App>(new Emitters); }
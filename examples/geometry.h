@@ -0,0 +1,135 @@
+// #include "common.h"
+#include <algorithm>
+#include <cmath>
+
+// Host-side geometry of soft2d's predefined shapes. Shapes are given in their
+// local space, where the object's center is the origin and its rotation is
+// zero, matching how `S2Kinematics` places them in the world.
+
+inline float dot(S2Vec2 a, S2Vec2 b) { return a.x * b.x + a.y * b.y; }
+
+inline float length(S2Vec2 a) { return std::sqrt(dot(a, a)); }
+
+inline S2Vec2 rotate(S2Vec2 a, float rotation) {
+  float c = std::cos(rotation);
+  float s = std::sin(rotation);
+  return vec2(c * a.x - s * a.y, s * a.x + c * a.y);
+}
+
+// Transform a world-space point into the local space of an object.
+inline S2Vec2 to_local(S2Vec2 p, S2Vec2 center, float rotation) {
+  return rotate(sub(p, center), -rotation);
+}
+
+// Transform a local-space point of an object into world space.
+inline S2Vec2 to_world(S2Vec2 p, S2Vec2 center, float rotation) {
+  return add(rotate(p, rotation), center);
+}
+
+// Signed distance from a local-space point to the boundary of a shape.
+// Negative values are inside the shape. The distances of boxes and ellipses are
+// approximations that are exact on the boundary.
+inline float shape_signed_distance(const S2Shape &shape, S2Vec2 p) {
+  switch (shape.type) {
+  case S2_SHAPE_TYPE_BOX: {
+    S2Vec2 h = shape.shape_union.box.half_extent;
+    float dx = std::abs(p.x) - h.x;
+    float dy = std::abs(p.y) - h.y;
+    float outside = length(vec2(std::max(dx, 0.0f), std::max(dy, 0.0f)));
+    return outside + std::min(std::max(dx, dy), 0.0f);
+  }
+  case S2_SHAPE_TYPE_CIRCLE:
+    return length(p) - shape.shape_union.circle.radius;
+  case S2_SHAPE_TYPE_ELLIPSE: {
+    float rx = shape.shape_union.ellipse.radius_x;
+    float ry = shape.shape_union.ellipse.radius_y;
+    float k = length(vec2(p.x / rx, p.y / ry));
+    return (k - 1.0f) * std::min(rx, ry);
+  }
+  case S2_SHAPE_TYPE_CAPSULE: {
+    float h = shape.shape_union.capsule.rect_half_length;
+    float x = std::clamp(p.x, -h, h);
+    return length(vec2(p.x - x, p.y)) - shape.shape_union.capsule.cap_radius;
+  }
+  case S2_SHAPE_TYPE_POLYGON: {
+    const S2Vec2 *v = (const S2Vec2 *)shape.shape_union.polygon.vertices;
+    uint32_t n = shape.shape_union.polygon.vertex_num;
+    float min_dist_sqr = INFINITY;
+    bool inside = false;
+    for (uint32_t i = 0, j = n - 1; i < n; j = i++) {
+      S2Vec2 e = sub(v[i], v[j]);
+      S2Vec2 w = sub(p, v[j]);
+      float t = std::clamp(dot(w, e) / dot(e, e), 0.0f, 1.0f);
+      S2Vec2 d = sub(w, mul(e, t));
+      min_dist_sqr = std::min(min_dist_sqr, dot(d, d));
+      if ((v[i].y > p.y) != (v[j].y > p.y) &&
+          p.x < v[j].x + (p.y - v[j].y) / (v[i].y - v[j].y) * e.x) {
+        inside = !inside;
+      }
+    }
+    float dist = std::sqrt(min_dist_sqr);
+    return inside ? -dist : dist;
+  }
+  default:
+    return INFINITY;
+  }
+}
+
+inline bool point_in_shape(const S2Shape &shape, S2Vec2 p) {
+  return shape_signed_distance(shape, p) <= 0.0f;
+}
+
+// The bounding box of a shape in its local space.
+inline void shape_local_aabb(const S2Shape &shape, S2Vec2 &lower,
+                             S2Vec2 &upper) {
+  S2Vec2 h{};
+  switch (shape.type) {
+  case S2_SHAPE_TYPE_BOX:
+    h = shape.shape_union.box.half_extent;
+    break;
+  case S2_SHAPE_TYPE_CIRCLE:
+    h = vec2(shape.shape_union.circle.radius, shape.shape_union.circle.radius);
+    break;
+  case S2_SHAPE_TYPE_ELLIPSE:
+    h = vec2(shape.shape_union.ellipse.radius_x,
+             shape.shape_union.ellipse.radius_y);
+    break;
+  case S2_SHAPE_TYPE_CAPSULE:
+    h = vec2(shape.shape_union.capsule.rect_half_length +
+                 shape.shape_union.capsule.cap_radius,
+             shape.shape_union.capsule.cap_radius);
+    break;
+  case S2_SHAPE_TYPE_POLYGON: {
+    const S2Vec2 *v = (const S2Vec2 *)shape.shape_union.polygon.vertices;
+    uint32_t n = shape.shape_union.polygon.vertex_num;
+    lower = vec2(INFINITY, INFINITY);
+    upper = vec2(-INFINITY, -INFINITY);
+    for (uint32_t i = 0; i < n; ++i) {
+      lower = vec2(std::min(lower.x, v[i].x), std::min(lower.y, v[i].y));
+      upper = vec2(std::max(upper.x, v[i].x), std::max(upper.y, v[i].y));
+    }
+    return;
+  }
+  default:
+    break;
+  }
+  lower = mul(h, -1.0f);
+  upper = h;
+}
+
+// The world-space bounding box of a shape placed at `center` with `rotation`.
+inline void shape_world_aabb(const S2Shape &shape, S2Vec2 center,
+                             float rotation, S2Vec2 &lower, S2Vec2 &upper) {
+  S2Vec2 local_lower;
+  S2Vec2 local_upper;
+  shape_local_aabb(shape, local_lower, local_upper);
+  S2Vec2 corners[4] = {local_lower, vec2(local_upper.x, local_lower.y),
+                       local_upper, vec2(local_lower.x, local_upper.y)};
+  lower = vec2(INFINITY, INFINITY);
+  upper = vec2(-INFINITY, -INFINITY);
+  for (auto &corner : corners) {
+    S2Vec2 p = to_world(corner, center, rotation);
+    lower = vec2(std::min(lower.x, p.x), std::min(lower.y, p.y));
+    upper = vec2(std::max(upper.x, p.x), std::max(upper.y, p.y));
+  }
+}
@@ -0,0 +1,215 @@
+// #include "common.h"
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// A particle manipulation callback with a user data pointer. It is invoked on
+// a contiguous chunk of the particles in a trigger and may run on several
+// threads at once, so it must be safe to call concurrently on disjoint chunks.
+typedef void (*ParticleChunkCallback)(S2Particle *particles, uint32_t size,
+                                      void *user_data);
+
+namespace parallel_callback_detail {
+
+// `S2ParticleManipulationCallback` carries no user data, so every pending
+// registration is bound to one of a fixed set of trampoline functions, each
+// reading its own slot.
+constexpr uint32_t kSlotNum = 16;
+
+struct Slot {
+  S2Trigger trigger;
+  ParticleChunkCallback callback;
+  void *user_data;
+  uint32_t thread_num;
+  uint32_t min_chunk_size;
+  bool in_use;
+};
+
+inline Slot slots[kSlotNum]{};
+inline std::mutex slots_mutex;
+
+// A persistent pool of worker threads running parallel-for jobs. The calling
+// thread takes part in every job, so `thread_num` threads need
+// `thread_num - 1` workers. Workers are only spawned when a job asks for more
+// threads than the pool has, and are joined at exit.
+struct WorkerPool {
+  std::vector<std::thread> workers_{};
+  std::mutex dispatch_mutex_{};
+  std::mutex mutex_{};
+  std::condition_variable work_cv_{};
+  std::condition_variable done_cv_{};
+  std::function<void(uint32_t)> job_{};
+  uint32_t job_size_{0};
+  uint32_t next_{0};
+  uint32_t done_{0};
+  uint64_t generation_{0};
+  bool stopping_{false};
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto &worker : workers_) {
+      worker.join();
+    }
+  }
+
+  // Run `job(0)` to `job(job_size - 1)` on up to `thread_num` threads and
+  // return when all of them have finished.
+  void ParallelFor(uint32_t job_size, uint32_t thread_num,
+                   const std::function<void(uint32_t)> &job) {
+    std::lock_guard<std::mutex> dispatch_lock(dispatch_mutex_);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      while (workers_.size() + 1 < thread_num) {
+        workers_.emplace_back([this]() { Work(); });
+      }
+      job_ = job;
+      job_size_ = job_size;
+      next_ = 0;
+      done_ = 0;
+      ++generation_;
+    }
+    work_cv_.notify_all();
+    RunJobs();
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this]() { return done_ == job_size_; });
+    job_ = nullptr;
+  }
+
+  void RunJobs() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (next_ < job_size_) {
+      uint32_t index = next_++;
+      lock.unlock();
+      job_(index);
+      lock.lock();
+      if (++done_ == job_size_) {
+        done_cv_.notify_one();
+      }
+    }
+  }
+
+  void Work() {
+    uint64_t generation = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        work_cv_.wait(lock, [&]() {
+          return stopping_ || generation_ != generation;
+        });
+        if (stopping_) {
+          return;
+        }
+        generation = generation_;
+      }
+      RunJobs();
+    }
+  }
+};
+
+inline WorkerPool pool;
+
+inline void run(const Slot &slot, S2Particle *particles, uint32_t size) {
+  uint32_t chunk_num =
+      std::min(slot.thread_num,
+               (size + slot.min_chunk_size - 1) / slot.min_chunk_size);
+  if (chunk_num <= 1) {
+    slot.callback(particles, size, slot.user_data);
+    return;
+  }
+  uint32_t chunk_size = (size + chunk_num - 1) / chunk_num;
+  pool.ParallelFor(chunk_num, chunk_num, [&](uint32_t chunk) {
+    uint32_t begin = chunk * chunk_size;
+    uint32_t end = std::min(begin + chunk_size, size);
+    if (begin < end) {
+      slot.callback(particles + begin, end - begin, slot.user_data);
+    }
+  });
+}
+
+template <uint32_t I> void trampoline(S2Particle *particles, uint32_t size) {
+  Slot slot;
+  {
+    std::lock_guard<std::mutex> lock(slots_mutex);
+    slot = slots[I];
+    slots[I].in_use = false;
+  }
+  // The slot was released by `release_particle_manipulation_slots()`.
+  if (!slot.in_use) {
+    return;
+  }
+  run(slot, particles, size);
+}
+
+template <uint32_t... I>
+constexpr std::array<S2ParticleManipulationCallback, kSlotNum>
+make_trampolines(std::integer_sequence<uint32_t, I...>) {
+  return {&trampoline<I>...};
+}
+
+inline constexpr auto trampolines =
+    make_trampolines(std::make_integer_sequence<uint32_t, kSlotNum>{});
+
+} // namespace parallel_callback_detail
+
+// Same as `s2_manipulate_particles_in_trigger()`, but the callback receives
+// `user_data` and the particle range is split into up to `thread_num` chunks
+// of at least `min_chunk_size` particles that are processed concurrently.
+//
+// Up to 16 registrations can be pending at the same time; a slot is released
+// when soft2d invokes the callback before the next step, or by
+// `release_particle_manipulation_slots()` for the trigger. Returns false and
+// registers nothing if all slots are pending. Chunks run on a persistent worker
+// pool.
+inline bool manipulate_particles_in_trigger_parallel(
+    S2Trigger trigger, ParticleChunkCallback callback, void *user_data,
+    uint32_t thread_num = std::thread::hardware_concurrency(),
+    uint32_t min_chunk_size = 4096) {
+  using namespace parallel_callback_detail;
+  uint32_t slot_index = kSlotNum;
+  {
+    std::lock_guard<std::mutex> lock(slots_mutex);
+    for (uint32_t i = 0; i < kSlotNum; ++i) {
+      if (!slots[i].in_use) {
+        slots[i] = {trigger,
+                    callback,
+                    user_data,
+                    std::max(thread_num, 1u),
+                    std::max(min_chunk_size, 1u),
+                    true};
+        slot_index = i;
+        break;
+      }
+    }
+  }
+  if (slot_index == kSlotNum) {
+    return false;
+  }
+  s2_manipulate_particles_in_trigger(trigger, trampolines[slot_index]);
+  return true;
+}
+
+// Release the pending registrations of `trigger`. Soft2D runs manipulation
+// callbacks before the next step, so a registration still pending after
+// `s2_step()` returns was skipped, e.g. because its trigger was destroyed, and
+// would otherwise keep its slot forever. Call this when destroying a trigger
+// that may have callbacks pending. Released callbacks are never run, and the
+// registrations of other triggers are left untouched.
+inline void release_particle_manipulation_slots(S2Trigger trigger) {
+  using namespace parallel_callback_detail;
+  std::lock_guard<std::mutex> lock(slots_mutex);
+  for (auto &slot : slots) {
+    if (slot.trigger == trigger) {
+      slot.in_use = false;
+    }
+  }
+}
@@ -0,0 +1,74 @@
+// #include "common.h"
+#include <cstring>
+
+// Keeps a host-side copy of a world's particle number without stalling the
+// device. Every `Update()` records a copy of `S2_BUFFER_NAME_PARTICLE_NUM` into
+// one of two host-visible staging buffers and reads the one recorded two
+// updates ago. The cached value therefore lags the device by two frames.
+//
+// `Update()` never waits, so it cannot tell whether the copy it reads has
+// actually executed. It relies on the application keeping at most one frame in
+// flight, i.e. waiting for the device (for example when presenting) at least
+// once between two updates. If the device falls further behind, the value read
+// is still a particle number the world had at some earlier frame, just older
+// than two frames.
+struct ParticleCounter {
+  TiRuntime runtime{TI_NULL_HANDLE};
+  S2World world{S2_NULL_HANDLE};
+
+  TiMemory staging_[2]{TI_NULL_HANDLE, TI_NULL_HANDLE};
+  TiDataType elem_type_{TI_DATA_TYPE_I32};
+  uint32_t update_count_{0};
+  uint32_t cached_particle_num_{0};
+
+  ParticleCounter(){};
+  ParticleCounter(TiRuntime runtime, S2World world)
+      : runtime(runtime), world(world) {
+    TiMemoryAllocateInfo mai{};
+    mai.size = sizeof(uint32_t);
+    mai.host_read = TI_TRUE;
+    mai.usage = TI_MEMORY_USAGE_STORAGE_BIT;
+    staging_[0] = ti_allocate_memory(runtime, &mai);
+    staging_[1] = ti_allocate_memory(runtime, &mai);
+  }
+
+  // Should be called once per frame after `s2_step()` and before the frame's
+  // commands are flushed.
+  void Update() {
+    TiMemory staging = staging_[update_count_ % 2];
+    if (update_count_ >= 2) {
+      uint32_t raw = 0;
+      void *mapped = ti_map_memory(runtime, staging);
+      std::memcpy(&raw, mapped, sizeof(raw));
+      ti_unmap_memory(runtime, staging);
+      cached_particle_num_ = decode_particle_num(elem_type_, raw);
+    }
+
+    TiNdArray particle_num;
+    s2_get_buffer(world, S2_BUFFER_NAME_PARTICLE_NUM, &particle_num);
+    elem_type_ = particle_num.elem_type;
+    TiMemorySlice src;
+    src.memory = particle_num.memory;
+    src.offset = 0;
+    src.size = sizeof(uint32_t);
+    TiMemorySlice dst;
+    dst.memory = staging;
+    dst.offset = 0;
+    dst.size = sizeof(uint32_t);
+    ti_copy_memory_device_to_device(runtime, &dst, &src);
+    ++update_count_;
+  }
+
+  uint32_t Get() const { return cached_particle_num_; }
+
+  void Destroy() {
+    // The last copies may still be pending.
+    ti_wait(runtime);
+    for (auto &staging : staging_) {
+      if (staging != TI_NULL_HANDLE) {
+        ti_free_memory(runtime, staging);
+        staging = TI_NULL_HANDLE;
+      }
+    }
+  }
+};
@@ -0,0 +1,63 @@
+// #include "common.h"
+#include <vector>
+
+// Helpers to run user-provided Taichi AOT kernels that read soft2d's particle
+// buffers on the device, e.g. to reduce or classify particles without reading
+// them back to the host. Kernels are loaded from a user module with
+// `ti_load_aot_module()` or `ti_create_aot_module()` and fetched with
+// `ti_get_aot_module_kernel()`.
+//
+// The kernel's leading arguments must be declared in this order:
+//   0. particle_num: ndarray, see `S2_BUFFER_NAME_PARTICLE_NUM`
+//   1. position: ndarray of float2, see `S2_BUFFER_NAME_PARTICLE_POSITION`
+//   2. velocity: ndarray of float2, see `S2_BUFFER_NAME_PARTICLE_VELOCITY`
+//   3. tag: ndarray of int, see `S2_BUFFER_NAME_PARTICLE_TAG`
+//   4. id: ndarray of int, see `S2_BUFFER_NAME_PARTICLE_ID`
+// followed by any user arguments.
+//
+// Soft2D only exposes these buffers for rendering and debugging, so kernels
+// must not write them. Results go to user ndarrays passed as user arguments.
+// To modify particles, use `s2_manipulate_particles_in_trigger()` instead.
+
+inline void launch_particle_kernel(const TiRuntime &runtime, S2World world,
+                                   TiKernel kernel, uint32_t extra_arg_num = 0,
+                                   const TiArgument *extra_args = nullptr) {
+  const S2BufferName buffer_names[] = {
+      S2_BUFFER_NAME_PARTICLE_NUM, S2_BUFFER_NAME_PARTICLE_POSITION,
+      S2_BUFFER_NAME_PARTICLE_VELOCITY, S2_BUFFER_NAME_PARTICLE_TAG,
+      S2_BUFFER_NAME_PARTICLE_ID};
+  std::vector<TiArgument> args;
+  for (auto buffer_name : buffer_names) {
+    TiArgument arg{};
+    arg.type = TI_ARGUMENT_TYPE_NDARRAY;
+    s2_get_buffer(world, buffer_name, &arg.value.ndarray);
+    args.push_back(arg);
+  }
+  args.insert(args.end(), extra_args, extra_args + extra_arg_num);
+  ti_launch_kernel(runtime, kernel, args.size(), args.data());
+}
+
+// Same as `launch_particle_kernel()`, but also passes the trigger's current
+// placement so that the kernel can restrict itself to the particles inside the
+// trigger. The particle buffers are followed by three float arguments: the
+// trigger's center x, center y and rotation, and then the user arguments.
+//
+// Soft2D does not export trigger shapes, so the trigger's shape is not passed.
+// The kernel has to hard-code the geometry or receive it through the user
+// arguments.
+inline void launch_particle_kernel_in_trigger(
+    const TiRuntime &runtime, S2World world, S2Trigger trigger,
+    TiKernel kernel, uint32_t extra_arg_num = 0,
+    const TiArgument *extra_args = nullptr) {
+  S2Vec2 center = s2_get_trigger_position(trigger);
+  float rotation = s2_get_trigger_rotation(trigger);
+  std::vector<TiArgument> args(3);
+  args[0].type = TI_ARGUMENT_TYPE_F32;
+  args[0].value.f32 = center.x;
+  args[1].type = TI_ARGUMENT_TYPE_F32;
+  args[1].value.f32 = center.y;
+  args[2].type = TI_ARGUMENT_TYPE_F32;
+  args[2].value.f32 = rotation;
+  args.insert(args.end(), extra_args, extra_args + extra_arg_num);
+  launch_particle_kernel(runtime, world, kernel, args.size(), args.data());
+}
@@ -0,0 +1,293 @@
+// #include "common.h"
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+// A persistent host-visible staging buffer that gathers several device-buffer
+// copies and reads them back with a single flush and wait. The staging memory
+// is kept between reads and only grows.
+struct ReadbackBuffer {
+  struct Copy {
+    TiMemorySlice src;
+    size_t offset;
+  };
+
+  TiRuntime runtime{TI_NULL_HANDLE};
+
+  TiMemory staging_{TI_NULL_HANDLE};
+  size_t capacity_{0};
+  size_t size_{0};
+  std::vector<Copy> copies_{};
+  std::vector<uint8_t> data_{};
+
+  ReadbackBuffer(){};
+  ReadbackBuffer(TiRuntime runtime) : runtime(runtime) {}
+
+  // Queue a copy of `size_in_bytes` bytes of `src` starting at byte
+  // `src_offset`, and return its offset in the data returned by `GetData()`
+  // after the next `Read()`.
+  size_t Add(const TiNdArray &src, size_t size_in_bytes,
+             size_t src_offset = 0) {
+    size_t offset = size_;
+    copies_.push_back({{src.memory, src_offset, size_in_bytes}, offset});
+    // Keep every copy 16-byte aligned.
+    size_ += (size_in_bytes + 15) / 16 * 16;
+    return offset;
+  }
+
+  // Record all queued copies, wait for them once and clear the queue. This
+  // waits until all device commands submitted before have finished.
+  void Read() {
+    if (size_ > capacity_) {
+      if (staging_ != TI_NULL_HANDLE) {
+        ti_free_memory(runtime, staging_);
+      }
+      capacity_ = std::max(size_, capacity_ * 2);
+      TiMemoryAllocateInfo mai{};
+      mai.size = capacity_;
+      mai.host_read = TI_TRUE;
+      mai.usage = TI_MEMORY_USAGE_STORAGE_BIT;
+      staging_ = ti_allocate_memory(runtime, &mai);
+    }
+    for (auto &copy : copies_) {
+      if (copy.src.size == 0) {
+        continue;
+      }
+      TiMemorySlice dst;
+      dst.memory = staging_;
+      dst.offset = copy.offset;
+      dst.size = copy.src.size;
+      ti_copy_memory_device_to_device(runtime, &dst, &copy.src);
+    }
+    ti_flush(runtime);
+    ti_wait(runtime);
+
+    data_.resize(size_);
+    if (size_ != 0) {
+      void *mapped = ti_map_memory(runtime, staging_);
+      std::memcpy(data_.data(), mapped, size_);
+      ti_unmap_memory(runtime, staging_);
+    }
+    copies_.clear();
+    size_ = 0;
+  }
+
+  const void *GetData(size_t offset) const { return data_.data() + offset; }
+
+  void Destroy() {
+    if (staging_ != TI_NULL_HANDLE) {
+      ti_free_memory(runtime, staging_);
+      staging_ = TI_NULL_HANDLE;
+    }
+    capacity_ = 0;
+  }
+};
+
+// Reads a world's particle number together with the live prefix of a fixed set
+// of particle buffers, such as `S2_BUFFER_NAME_PARTICLE_POSITION`.
+//
+// The particle number is not known on the host before the read, so each
+// buffer's prefix is sized from the number seen by the previous read plus some
+// headroom. This takes a single wait unless the particle number grew past the
+// headroom, in which case the missing particles are read with a second wait.
+struct ParticleReadback {
+  S2World world{S2_NULL_HANDLE};
+  std::vector<S2BufferName> buffer_names{};
+  std::vector<size_t> elem_sizes{};
+
+  ReadbackBuffer readback_{};
+  std::vector<size_t> offsets_{};
+  std::vector<std::vector<uint8_t>> data_{};
+  uint32_t expected_particle_num_{0};
+  uint32_t particle_num_{0};
+
+  ParticleReadback(){};
+  ParticleReadback(TiRuntime runtime, S2World world,
+                   std::vector<S2BufferName> buffer_names,
+                   std::vector<size_t> elem_sizes)
+      : world(world), buffer_names(std::move(buffer_names)),
+        elem_sizes(std::move(elem_sizes)), readback_(runtime) {
+    offsets_.resize(this->buffer_names.size());
+    data_.resize(this->buffer_names.size());
+  }
+
+  // Read the particle number and the buffers back, and return the particle
+  // number. Should be called after `s2_step()`.
+  uint32_t Read() {
+    TiNdArray particle_num_buffer;
+    s2_get_buffer(world, S2_BUFFER_NAME_PARTICLE_NUM, &particle_num_buffer);
+    size_t particle_num_offset =
+        readback_.Add(particle_num_buffer, sizeof(uint32_t));
+    uint32_t copied_num = expected_particle_num_;
+    AddBuffers(0, copied_num);
+    readback_.Read();
+
+    uint32_t raw;
+    std::memcpy(&raw, readback_.GetData(particle_num_offset), sizeof(raw));
+    particle_num_ = decode_particle_num(particle_num_buffer.elem_type, raw);
+    for (size_t i = 0; i < buffer_names.size(); ++i) {
+      const uint8_t *src = (const uint8_t *)readback_.GetData(offsets_[i]);
+      size_t size = elem_sizes[i] * std::min(copied_num, particle_num_);
+      data_[i].assign(src, src + size);
+    }
+
+    if (particle_num_ > copied_num) {
+      AddBuffers(copied_num, particle_num_);
+      readback_.Read();
+      for (size_t i = 0; i < buffer_names.size(); ++i) {
+        const uint8_t *src = (const uint8_t *)readback_.GetData(offsets_[i]);
+        data_[i].insert(data_[i].end(), src,
+                        src + elem_sizes[i] * (particle_num_ - copied_num));
+      }
+    }
+
+    uint32_t capacity = s2_get_world_config(world).max_allowed_particle_num;
+    expected_particle_num_ = std::min(
+        capacity, particle_num_ + std::max(particle_num_ / 8, 1024u));
+    return particle_num_;
+  }
+
+  uint32_t GetParticleNum() const { return particle_num_; }
+
+  // The live prefix of `buffer_names[index]` from the last `Read()`.
+  const void *GetData(uint32_t index) const { return data_[index].data(); }
+
+  void Destroy() { readback_.Destroy(); }
+
+  // Queue the particles `[begin, end)` of every buffer.
+  void AddBuffers(uint32_t begin, uint32_t end) {
+    for (size_t i = 0; i < buffer_names.size(); ++i) {
+      TiNdArray buffer;
+      s2_get_buffer(world, buffer_names[i], &buffer);
+      offsets_[i] = readback_.Add(buffer, elem_sizes[i] * (end - begin),
+                                  elem_sizes[i] * begin);
+    }
+  }
+};
+
+// Same as `ParticleReadback`, but never waits. Every `Update()` records the
+// copies into one of two host-visible staging buffers and reads the one
+// recorded two updates ago, so the data lags the device by two frames. Like
+// `ParticleCounter`, this relies on the application keeping at most one frame
+// in flight.
+//
+// Each buffer's prefix is sized from the particle number of the previous read
+// plus some headroom. If the world grew past it, only the first
+// `GetAvailableNum()` particles of the read data are present.
+struct LaggedParticleReadback {
+  struct Slot {
+    TiMemory memory;
+    size_t capacity;
+    uint32_t copied_num;
+    TiDataType elem_type;
+  };
+
+  TiRuntime runtime{TI_NULL_HANDLE};
+  S2World world{S2_NULL_HANDLE};
+  std::vector<S2BufferName> buffer_names{};
+  std::vector<size_t> elem_sizes{};
+
+  Slot slots_[2]{};
+  std::vector<std::vector<uint8_t>> data_{};
+  uint32_t update_count_{0};
+  uint32_t expected_particle_num_{0};
+  uint32_t particle_num_{0};
+  uint32_t available_num_{0};
+
+  LaggedParticleReadback(){};
+  LaggedParticleReadback(TiRuntime runtime, S2World world,
+                         std::vector<S2BufferName> buffer_names,
+                         std::vector<size_t> elem_sizes)
+      : runtime(runtime), world(world), buffer_names(std::move(buffer_names)),
+        elem_sizes(std::move(elem_sizes)) {
+    data_.resize(this->buffer_names.size());
+    // Copy everything until the first particle number is known.
+    expected_particle_num_ =
+        s2_get_world_config(world).max_allowed_particle_num;
+  }
+
+  // Should be called once per frame after `s2_step()` and before the frame's
+  // commands are flushed.
+  void Update() {
+    Slot &slot = slots_[update_count_ % 2];
+    if (update_count_ >= 2) {
+      const uint8_t *mapped =
+          (const uint8_t *)ti_map_memory(runtime, slot.memory);
+      uint32_t raw;
+      std::memcpy(&raw, mapped, sizeof(raw));
+      particle_num_ = decode_particle_num(slot.elem_type, raw);
+      available_num_ = std::min(particle_num_, slot.copied_num);
+      size_t offset = 16;
+      for (size_t i = 0; i < buffer_names.size(); ++i) {
+        const uint8_t *src = mapped + offset;
+        data_[i].assign(src, src + elem_sizes[i] * available_num_);
+        offset += (elem_sizes[i] * slot.copied_num + 15) / 16 * 16;
+      }
+      ti_unmap_memory(runtime, slot.memory);
+      uint32_t capacity = s2_get_world_config(world).max_allowed_particle_num;
+      expected_particle_num_ = std::min(
+          capacity, particle_num_ + std::max(particle_num_ / 8, 1024u));
+    }
+
+    // The slot's previous copies were read above, so it can be reallocated.
+    size_t size = 16;
+    for (size_t elem_size : elem_sizes) {
+      size += (elem_size * expected_particle_num_ + 15) / 16 * 16;
+    }
+    if (size > slot.capacity) {
+      if (slot.memory != TI_NULL_HANDLE) {
+        ti_free_memory(runtime, slot.memory);
+      }
+      slot.capacity = std::max(size, slot.capacity * 2);
+      TiMemoryAllocateInfo mai{};
+      mai.size = slot.capacity;
+      mai.host_read = TI_TRUE;
+      mai.usage = TI_MEMORY_USAGE_STORAGE_BIT;
+      slot.memory = ti_allocate_memory(runtime, &mai);
+    }
+
+    TiNdArray particle_num;
+    s2_get_buffer(world, S2_BUFFER_NAME_PARTICLE_NUM, &particle_num);
+    slot.elem_type = particle_num.elem_type;
+    slot.copied_num = expected_particle_num_;
+    TiMemorySlice src{particle_num.memory, 0, sizeof(uint32_t)};
+    TiMemorySlice dst{slot.memory, 0, sizeof(uint32_t)};
+    ti_copy_memory_device_to_device(runtime, &dst, &src);
+    size_t offset = 16;
+    for (size_t i = 0; i < buffer_names.size(); ++i) {
+      size_t copy_size = elem_sizes[i] * slot.copied_num;
+      if (copy_size != 0) {
+        TiNdArray buffer;
+        s2_get_buffer(world, buffer_names[i], &buffer);
+        src = {buffer.memory, 0, copy_size};
+        dst = {slot.memory, offset, copy_size};
+        ti_copy_memory_device_to_device(runtime, &dst, &src);
+      }
+      offset += (copy_size + 15) / 16 * 16;
+    }
+    ++update_count_;
+  }
+
+  // Whether any data has been read yet.
+  bool IsValid() const { return update_count_ > 2; }
+
+  uint32_t GetParticleNum() const { return particle_num_; }
+
+  // The number of particles present in `GetData()`, which is less than
+  // `GetParticleNum()` if the world outgrew the copied prefix.
+  uint32_t GetAvailableNum() const { return available_num_; }
+
+  const void *GetData(uint32_t index) const { return data_[index].data(); }
+
+  void Destroy() {
+    // The last copies may still be pending.
+    ti_wait(runtime);
+    for (auto &slot : slots_) {
+      if (slot.memory != TI_NULL_HANDLE) {
+        ti_free_memory(runtime, slot.memory);
+      }
+      slot = Slot{};
+    }
+  }
+};
@@ -0,0 +1,166 @@
+// #include "common.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// A static terrain collider built from an occupancy bitmap.
+//
+// The bitmap is split into square tiles of `tile_size` cells, and the occupied
+// cells of every tile are greedily merged into as few box colliders as
+// possible, so a solid region costs a handful of colliders instead of one per
+// cell. Carving or filling terrain with `Update()` only rebuilds the colliders
+// of the tiles touching the updated sub-rectangle.
+//
+// Cell `(x, y)` of the bitmap covers the world-space square from `origin +
+// (x, y) * cell_size` to `origin + (x + 1, y + 1) * cell_size`; row 0 is the
+// bottom row. Any non-zero value marks a cell as solid.
+struct TerrainCollider {
+  S2World world{S2_NULL_HANDLE};
+  S2Vec2 origin{};
+  float cell_size{0.0f};
+  uint32_t width{0};
+  uint32_t height{0};
+  uint32_t tile_size{32};
+  S2CollisionParameter collision_parameter{
+      S2CollisionType::S2_COLLISION_TYPE_SEPARATE, 0.0f, 0.0f};
+
+  std::vector<uint8_t> occupancy_{};
+  uint32_t tile_num_x_{0};
+  uint32_t tile_num_y_{0};
+  std::vector<std::vector<S2Collider>> tile_colliders_{};
+
+  TerrainCollider(){};
+  TerrainCollider(S2World world, const uint8_t *occupancy, uint32_t width,
+                  uint32_t height, S2Vec2 origin, float cell_size,
+                  uint32_t tile_size = 32)
+      : world(world), origin(origin), cell_size(cell_size), width(width),
+        height(height), tile_size(std::max(tile_size, 1u)),
+        occupancy_(occupancy, occupancy + (size_t)width * height) {
+    tile_num_x_ = (width + this->tile_size - 1) / this->tile_size;
+    tile_num_y_ = (height + this->tile_size - 1) / this->tile_size;
+    tile_colliders_.resize(tile_num_x_ * tile_num_y_);
+    for (uint32_t ty = 0; ty < tile_num_y_; ++ty) {
+      for (uint32_t tx = 0; tx < tile_num_x_; ++tx) {
+        RebuildTile(tx, ty);
+      }
+    }
+  }
+
+  void SetCollisionParameter(const S2CollisionParameter &cp) {
+    collision_parameter = cp;
+  }
+
+  // Overwrite the `w * h` cells starting at cell `(x, y)` with `data`, given
+  // row by row from the bottom row, and rebuild the affected tiles.
+  void Update(uint32_t x, uint32_t y, uint32_t w, uint32_t h,
+              const uint8_t *data) {
+    if (x >= width || y >= height || w == 0 || h == 0) {
+      return;
+    }
+    // Clip against the bitmap without computing `x + w`, which may overflow.
+    uint32_t x_end = x + std::min(w, width - x);
+    uint32_t y_end = y + std::min(h, height - y);
+    for (uint32_t j = y; j < y_end; ++j) {
+      for (uint32_t i = x; i < x_end; ++i) {
+        occupancy_[(size_t)j * width + i] =
+            data[(size_t)(j - y) * w + (i - x)];
+      }
+    }
+    for (uint32_t ty = y / tile_size; ty <= (y_end - 1) / tile_size; ++ty) {
+      for (uint32_t tx = x / tile_size; tx <= (x_end - 1) / tile_size; ++tx) {
+        RebuildTile(tx, ty);
+      }
+    }
+  }
+
+  // Fill (`solid = true`) or carve (`solid = false`) a rectangle of cells.
+  void Fill(uint32_t x, uint32_t y, uint32_t w, uint32_t h, bool solid) {
+    if (x >= width || y >= height) {
+      return;
+    }
+    w = std::min(w, width - x);
+    h = std::min(h, height - y);
+    std::vector<uint8_t> data((size_t)w * h, solid ? 1 : 0);
+    Update(x, y, w, h, data.data());
+  }
+
+  // Cells outside the bitmap are not solid.
+  bool IsSolid(uint32_t x, uint32_t y) const {
+    if (x >= width || y >= height) {
+      return false;
+    }
+    return occupancy_[(size_t)y * width + x] != 0;
+  }
+
+  uint32_t GetColliderNum() const {
+    uint32_t out = 0;
+    for (auto &colliders : tile_colliders_) {
+      out += colliders.size();
+    }
+    return out;
+  }
+
+  void Destroy() {
+    for (auto &colliders : tile_colliders_) {
+      for (auto collider : colliders) {
+        s2_destroy_collider(collider);
+      }
+      colliders.clear();
+    }
+  }
+
+  void RebuildTile(uint32_t tx, uint32_t ty) {
+    auto &colliders = tile_colliders_[ty * tile_num_x_ + tx];
+    for (auto collider : colliders) {
+      s2_destroy_collider(collider);
+    }
+    colliders.clear();
+
+    uint32_t x0 = tx * tile_size;
+    uint32_t y0 = ty * tile_size;
+    uint32_t x1 = std::min(x0 + tile_size, width);
+    uint32_t y1 = std::min(y0 + tile_size, height);
+    uint32_t tile_w = x1 - x0;
+    std::vector<uint8_t> merged(tile_w * (y1 - y0), 0);
+    auto is_free = [&](uint32_t x, uint32_t y) {
+      return IsSolid(x, y) && !merged[(y - y0) * tile_w + (x - x0)];
+    };
+
+    for (uint32_t y = y0; y < y1; ++y) {
+      for (uint32_t x = x0; x < x1; ++x) {
+        if (!is_free(x, y)) {
+          continue;
+        }
+        // Grow the box along x first, then along y while whole rows match.
+        uint32_t box_x1 = x + 1;
+        while (box_x1 < x1 && is_free(box_x1, y)) {
+          ++box_x1;
+        }
+        uint32_t box_y1 = y + 1;
+        while (box_y1 < y1) {
+          bool row_free = true;
+          for (uint32_t i = x; i < box_x1 && row_free; ++i) {
+            row_free = is_free(i, box_y1);
+          }
+          if (!row_free) {
+            break;
+          }
+          ++box_y1;
+        }
+        for (uint32_t j = y; j < box_y1; ++j) {
+          for (uint32_t i = x; i < box_x1; ++i) {
+            merged[(j - y0) * tile_w + (i - x0)] = 1;
+          }
+        }
+
+        S2Vec2 half_extent =
+            mul(vec2(box_x1 - x, box_y1 - y), 0.5f * cell_size);
+        S2Vec2 center =
+            add(origin, add(mul(vec2(x, y), cell_size), half_extent));
+        colliders.push_back(create_collider(world, make_kinematics(center),
+                                            make_box_shape(half_extent),
+                                            collision_parameter));
+      }
+    }
+  }
+};
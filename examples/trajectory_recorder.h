@@ -0,0 +1,463 @@
+// #include "common.h"
+// #include "particle_readback.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// A compressed recording of per-frame particle state.
+//
+// Positions are quantized to 16 bits relative to the world's offset and
+// extent, and velocities to 16 bits within `[-velocity_range,
+// velocity_range]`. Every frame is delta-encoded against the previous frame,
+// matching particles by `S2_BUFFER_NAME_PARTICLE_ID`, and deltas are stored as
+// zigzag varints. Frames are grouped into chunks of `frames_per_chunk` frames
+// whose first frame is encoded against zero, so any frame can be decoded by
+// seeking to its chunk. A chunk table at the end of the file holds the offset
+// of every chunk.
+//
+// File layout:
+//   TrajectoryHeader
+//   frame*: varint particle_num, then per particle varint (id, x, y, vx, vy)
+//   uint64 chunk_offsets[chunk_num]
+//   uint32 chunk_num, uint32 frame_num, uint32 magic
+
+constexpr uint32_t kTrajectoryMagic = 0x54523253; // "S2RT"
+constexpr uint32_t kTrajectoryVersion = 1;
+
+struct TrajectoryHeader {
+  uint32_t magic;
+  uint32_t version;
+  S2Vec2 offset;
+  S2Vec2 extent;
+  float velocity_range;
+  uint32_t frames_per_chunk;
+};
+
+struct TrajectoryFrame {
+  std::vector<uint32_t> ids{};
+  std::vector<S2Vec2> positions{};
+  std::vector<S2Vec2> velocities{};
+};
+
+namespace trajectory_detail {
+
+typedef std::array<int32_t, 4> QuantizedState;
+
+inline int32_t quantize(float value, float lower, float range) {
+  float t = (value - lower) / range;
+  // Also maps NaN to 0.
+  t = t > 0.0f ? std::min(t, 1.0f) : 0.0f;
+  return (int32_t)std::lround(t * 65535.0f);
+}
+
+inline float dequantize(int32_t q, float lower, float range) {
+  return lower + range * (q / 65535.0f);
+}
+
+inline void write_varint(std::vector<uint8_t> &out, int64_t value) {
+  uint64_t zigzag = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+  while (zigzag >= 0x80) {
+    out.push_back((uint8_t)(zigzag | 0x80));
+    zigzag >>= 7;
+  }
+  out.push_back((uint8_t)zigzag);
+}
+
+// `fseek()` takes a `long`, which is 32-bit on Windows.
+inline bool seek(std::FILE *file, int64_t offset, int origin) {
+#if defined(_WIN32)
+  return _fseeki64(file, offset, origin) == 0;
+#else
+  return fseeko(file, (off_t)offset, origin) == 0;
+#endif
+}
+
+inline int64_t tell(std::FILE *file) {
+#if defined(_WIN32)
+  return _ftelli64(file);
+#else
+  return (int64_t)ftello(file);
+#endif
+}
+
+inline bool read_varint(std::FILE *file, int64_t &value) {
+  uint64_t zigzag = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int byte = std::fgetc(file);
+    if (byte == EOF) {
+      return false;
+    }
+    zigzag |= (uint64_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      value = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace trajectory_detail
+
+// Streams particle state to a trajectory file. `Record()` reads the particle
+// buffers back on the calling thread, while quantization, encoding and file
+// writes run on a background thread, so the caller only pays for the
+// read-back. At most `max_pending_frame_num` frames are queued; recording more
+// blocks until the background thread catches up. Write errors stop the
+// recording and are reported by `Close()`, which must be called before the
+// runtime is destroyed.
+struct TrajectoryRecorder {
+  TrajectoryHeader header_{};
+  std::FILE *file_{nullptr};
+  uint64_t write_offset_{0};
+  uint32_t frame_num_{0};
+  std::vector<uint64_t> chunk_offsets_{};
+  std::unordered_map<uint32_t, trajectory_detail::QuantizedState> previous_{};
+  ParticleReadback readback_{};
+
+  std::thread worker_{};
+  std::mutex mutex_{};
+  std::condition_variable cv_{};
+  std::condition_variable pending_cv_{};
+  std::deque<TrajectoryFrame> pending_{};
+  size_t max_pending_frame_num_{8};
+  bool closing_{false};
+  std::atomic<bool> write_failed_{false};
+
+  TrajectoryRecorder() {}
+  TrajectoryRecorder(const TrajectoryRecorder &) = delete;
+  TrajectoryRecorder &operator=(const TrajectoryRecorder &) = delete;
+  ~TrajectoryRecorder() { Close(); }
+
+  // Start recording the particles of `world`. Velocities are clamped to
+  // `[-velocity_range, velocity_range]`, which must be positive, as must
+  // `frames_per_chunk` and `max_pending_frame_num`.
+  bool Open(const char *path, S2World world, float velocity_range,
+            uint32_t frames_per_chunk = 64, size_t max_pending_frame_num = 8) {
+    S2WorldConfig config = s2_get_world_config(world);
+    return Open(path, config.offset, config.extent, velocity_range,
+                frames_per_chunk, max_pending_frame_num);
+  }
+
+  // Same as above, but with explicit position bounds instead of a world's.
+  bool Open(const char *path, S2Vec2 offset, S2Vec2 extent,
+            float velocity_range, uint32_t frames_per_chunk = 64,
+            size_t max_pending_frame_num = 8) {
+    Close();
+    if (!(velocity_range > 0.0f) || !(extent.x > 0.0f) ||
+        !(extent.y > 0.0f) || frames_per_chunk == 0 ||
+        max_pending_frame_num == 0) {
+      return false;
+    }
+    file_ = std::fopen(path, "wb");
+    if (file_ == nullptr) {
+      return false;
+    }
+    header_.magic = kTrajectoryMagic;
+    header_.version = kTrajectoryVersion;
+    header_.offset = offset;
+    header_.extent = extent;
+    header_.velocity_range = velocity_range;
+    header_.frames_per_chunk = frames_per_chunk;
+    if (std::fwrite(&header_, sizeof(header_), 1, file_) != 1) {
+      std::fclose(file_);
+      file_ = nullptr;
+      return false;
+    }
+    write_offset_ = sizeof(header_);
+    frame_num_ = 0;
+    chunk_offsets_.clear();
+    previous_.clear();
+    max_pending_frame_num_ = max_pending_frame_num;
+    closing_ = false;
+    write_failed_ = false;
+    worker_ = std::thread([this]() { Run(); });
+    return true;
+  }
+
+  // Should be called after `s2_step()`. Waits for the device to finish.
+  void Record(const TiRuntime &runtime, S2World world) {
+    if (file_ == nullptr || write_failed_) {
+      return;
+    }
+    if (readback_.world != world || readback_.readback_.runtime != runtime) {
+      readback_.Destroy();
+      readback_ = ParticleReadback(runtime, world,
+                                   {S2_BUFFER_NAME_PARTICLE_ID,
+                                    S2_BUFFER_NAME_PARTICLE_POSITION,
+                                    S2_BUFFER_NAME_PARTICLE_VELOCITY},
+                                   {sizeof(uint32_t), sizeof(S2Vec2),
+                                    sizeof(S2Vec2)});
+    }
+    uint32_t n = readback_.Read();
+    const uint32_t *ids = (const uint32_t *)readback_.GetData(0);
+    const S2Vec2 *positions = (const S2Vec2 *)readback_.GetData(1);
+    const S2Vec2 *velocities = (const S2Vec2 *)readback_.GetData(2);
+    TrajectoryFrame frame;
+    frame.ids.assign(ids, ids + n);
+    frame.positions.assign(positions, positions + n);
+    frame.velocities.assign(velocities, velocities + n);
+    RecordFrame(std::move(frame));
+  }
+
+  // Queue an already read-back frame for encoding. Blocks while the queue is
+  // full.
+  void RecordFrame(TrajectoryFrame frame) {
+    if (file_ == nullptr || write_failed_) {
+      return;
+    }
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      pending_cv_.wait(lock, [this]() {
+        return pending_.size() < max_pending_frame_num_;
+      });
+      pending_.push_back(std::move(frame));
+    }
+    cv_.notify_one();
+  }
+
+  // Flush all pending frames, write the chunk table and close the file.
+  // Returns false if any write failed, in which case the file is incomplete.
+  bool Close() {
+    if (file_ == nullptr) {
+      return true;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closing_ = true;
+    }
+    cv_.notify_one();
+    worker_.join();
+
+    uint32_t chunk_num = chunk_offsets_.size();
+    bool ok =
+        !write_failed_ &&
+        std::fwrite(chunk_offsets_.data(), sizeof(uint64_t), chunk_num,
+                    file_) == chunk_num &&
+        std::fwrite(&chunk_num, sizeof(uint32_t), 1, file_) == 1 &&
+        std::fwrite(&frame_num_, sizeof(uint32_t), 1, file_) == 1 &&
+        std::fwrite(&header_.magic, sizeof(uint32_t), 1, file_) == 1;
+    ok = std::fclose(file_) == 0 && ok;
+    file_ = nullptr;
+    readback_.Destroy();
+    readback_ = ParticleReadback();
+    return ok;
+  }
+
+  void Run() {
+    std::vector<uint8_t> bytes;
+    while (true) {
+      TrajectoryFrame frame;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return closing_ || !pending_.empty(); });
+        if (pending_.empty()) {
+          return;
+        }
+        frame = std::move(pending_.front());
+        pending_.pop_front();
+      }
+      pending_cv_.notify_one();
+      if (write_failed_) {
+        continue;
+      }
+      bytes.clear();
+      Encode(frame, bytes);
+      if (std::fwrite(bytes.data(), 1, bytes.size(), file_) != bytes.size()) {
+        write_failed_ = true;
+        continue;
+      }
+      write_offset_ += bytes.size();
+    }
+  }
+
+  void Encode(const TrajectoryFrame &frame, std::vector<uint8_t> &out) {
+    using namespace trajectory_detail;
+    if (frame_num_ % header_.frames_per_chunk == 0) {
+      chunk_offsets_.push_back(write_offset_);
+      previous_.clear();
+    }
+    ++frame_num_;
+
+    uint32_t n = frame.ids.size();
+    write_varint(out, n);
+    std::unordered_map<uint32_t, QuantizedState> current;
+    current.reserve(n);
+    int64_t previous_id = 0;
+    float v_lower = -header_.velocity_range;
+    float v_range = 2.0f * header_.velocity_range;
+    for (uint32_t i = 0; i < n; ++i) {
+      uint32_t id = frame.ids[i];
+      QuantizedState q = {
+          quantize(frame.positions[i].x, header_.offset.x, header_.extent.x),
+          quantize(frame.positions[i].y, header_.offset.y, header_.extent.y),
+          quantize(frame.velocities[i].x, v_lower, v_range),
+          quantize(frame.velocities[i].y, v_lower, v_range)};
+      QuantizedState base{};
+      auto it = previous_.find(id);
+      if (it != previous_.end()) {
+        base = it->second;
+      }
+      write_varint(out, (int64_t)id - previous_id);
+      for (int k = 0; k < 4; ++k) {
+        write_varint(out, q[k] - base[k]);
+      }
+      previous_id = id;
+      current[id] = q;
+    }
+    previous_ = std::move(current);
+  }
+};
+
+// Random-access reader of files written by `TrajectoryRecorder`.
+struct TrajectoryReader {
+  TrajectoryHeader header_{};
+  std::FILE *file_{nullptr};
+  uint32_t frame_num_{0};
+  std::vector<uint64_t> chunk_offsets_{};
+  // The end of the frame data, i.e. the offset of the chunk table.
+  uint64_t data_end_{0};
+
+  TrajectoryReader() {}
+  TrajectoryReader(const TrajectoryReader &) = delete;
+  TrajectoryReader &operator=(const TrajectoryReader &) = delete;
+  ~TrajectoryReader() { Close(); }
+
+  // Open a trajectory file. Fails if the header or the chunk table is
+  // inconsistent with the file.
+  bool Open(const char *path) {
+    using namespace trajectory_detail;
+    Close();
+    file_ = std::fopen(path, "rb");
+    if (file_ == nullptr) {
+      return false;
+    }
+    uint32_t tail[3];
+    int64_t file_size = 0;
+    bool ok = std::fread(&header_, sizeof(header_), 1, file_) == 1 &&
+              header_.magic == kTrajectoryMagic &&
+              header_.version == kTrajectoryVersion &&
+              header_.frames_per_chunk != 0 &&
+              header_.velocity_range > 0.0f && header_.extent.x > 0.0f &&
+              header_.extent.y > 0.0f && seek(file_, 0, SEEK_END) &&
+              (file_size = tell(file_)) >= (int64_t)sizeof(tail) &&
+              seek(file_, -(int64_t)sizeof(tail), SEEK_END) &&
+              std::fread(tail, sizeof(tail), 1, file_) == 1 &&
+              tail[2] == kTrajectoryMagic;
+    if (ok) {
+      uint32_t chunk_num = tail[0];
+      frame_num_ = tail[1];
+      uint64_t expected_chunk_num =
+          ((uint64_t)frame_num_ + header_.frames_per_chunk - 1) /
+          header_.frames_per_chunk;
+      uint64_t table_size = sizeof(uint64_t) * (uint64_t)chunk_num +
+                            sizeof(tail);
+      ok = chunk_num == expected_chunk_num &&
+           sizeof(header_) + table_size <= (uint64_t)file_size;
+      if (ok) {
+        data_end_ = (uint64_t)file_size - table_size;
+        chunk_offsets_.resize(chunk_num);
+        ok = seek(file_, (int64_t)data_end_, SEEK_SET) &&
+             std::fread(chunk_offsets_.data(), sizeof(uint64_t), chunk_num,
+                        file_) == chunk_num;
+      }
+      for (size_t i = 0; ok && i < chunk_offsets_.size(); ++i) {
+        ok = chunk_offsets_[i] >= sizeof(header_) &&
+             chunk_offsets_[i] < data_end_;
+      }
+    }
+    if (!ok) {
+      Close();
+    }
+    return ok;
+  }
+
+  void Close() {
+    if (file_ != nullptr) {
+      std::fclose(file_);
+      file_ = nullptr;
+    }
+    frame_num_ = 0;
+    chunk_offsets_.clear();
+    data_end_ = 0;
+  }
+
+  uint32_t GetFrameNum() const { return frame_num_; }
+
+  // Decode frame `frame_index` by replaying its chunk from the chunk's first
+  // frame. Fails on malformed frame data.
+  bool ReadFrame(uint32_t frame_index, TrajectoryFrame &frame) {
+    using namespace trajectory_detail;
+    if (file_ == nullptr || frame_index >= frame_num_) {
+      return false;
+    }
+    uint32_t chunk = frame_index / header_.frames_per_chunk;
+    if (!seek(file_, (int64_t)chunk_offsets_[chunk], SEEK_SET)) {
+      return false;
+    }
+    std::unordered_map<uint32_t, QuantizedState> previous;
+    std::unordered_map<uint32_t, QuantizedState> current;
+    std::vector<uint32_t> ids;
+    uint32_t first = chunk * header_.frames_per_chunk;
+    for (uint32_t f = first; f <= frame_index; ++f) {
+      int64_t n = 0;
+      // Every particle takes at least five bytes.
+      if (!read_varint(file_, n) || n < 0 || (uint64_t)n > data_end_ / 5) {
+        return false;
+      }
+      ids.resize(n);
+      current.clear();
+      int64_t id = 0;
+      for (int64_t i = 0; i < n; ++i) {
+        int64_t delta[5];
+        for (auto &d : delta) {
+          if (!read_varint(file_, d)) {
+            return false;
+          }
+        }
+        if (delta[0] < -id || delta[0] > (int64_t)UINT32_MAX - id) {
+          return false;
+        }
+        id += delta[0];
+        QuantizedState base{};
+        auto it = previous.find((uint32_t)id);
+        if (it != previous.end()) {
+          base = it->second;
+        }
+        QuantizedState q;
+        for (int k = 0; k < 4; ++k) {
+          if (delta[k + 1] < -base[k] || delta[k + 1] > 65535 - base[k]) {
+            return false;
+          }
+          q[k] = base[k] + (int32_t)delta[k + 1];
+        }
+        ids[i] = (uint32_t)id;
+        current[(uint32_t)id] = q;
+      }
+      std::swap(previous, current);
+    }
+
+    float v_lower = -header_.velocity_range;
+    float v_range = 2.0f * header_.velocity_range;
+    frame.ids = ids;
+    frame.positions.resize(ids.size());
+    frame.velocities.resize(ids.size());
+    for (size_t i = 0; i < ids.size(); ++i) {
+      const QuantizedState &q = previous[ids[i]];
+      frame.positions[i] =
+          vec2(dequantize(q[0], header_.offset.x, header_.extent.x),
+               dequantize(q[1], header_.offset.y, header_.extent.y));
+      frame.velocities[i] = vec2(dequantize(q[2], v_lower, v_range),
+                                 dequantize(q[3], v_lower, v_range));
+    }
+    return true;
+  }
+};
@@ -0,0 +1,236 @@
+// #include "common.h"
+// #include "geometry.h"
+// #include "particle_readback.h"
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+enum TriggerEventType {
+  // The first matching particle entered the trigger.
+  TRIGGER_EVENT_TYPE_ENTER = 0,
+  // The last matching particle left the trigger.
+  TRIGGER_EVENT_TYPE_EXIT = 1,
+};
+
+// A transition of a trigger query between empty and non-empty.
+struct TriggerEvent {
+  // The index of the query returned by `TriggerQueryBatch::Add()`.
+  uint32_t query_index;
+  S2Trigger trigger;
+  uint32_t tag;
+  uint32_t mask;
+  TriggerEventType type;
+  // The number of matching particles in the trigger after the transition.
+  uint32_t particle_num;
+};
+
+// Evaluates many trigger queries with a single read-back per `Evaluate()`,
+// see `ParticleReadback`.
+//
+// Every query is a trigger together with a tag filter; a particle is counted
+// for a query if it lies inside the trigger and `(particle.tag & mask) ==
+// tag`. Registering a trigger with `tag = 0, mask = 0` counts all particles.
+// Soft2D does not export trigger shapes, so the shape used to create a trigger
+// must be registered together with it. Trigger positions and rotations are
+// fetched from soft2d at every evaluation.
+//
+// Unlike `s2_query_particle_num_in_trigger()`, this does not require
+// `S2WorldConfig.enable_world_query`. Shapes are tested analytically, so
+// particles right on a trigger's boundary may be classified differently from
+// soft2d's fine-grid discretization.
+struct TriggerQueryBatch {
+  struct Query {
+    S2Trigger trigger;
+    S2Shape shape;
+    std::vector<S2Vec2> polygon_vertices;
+    uint32_t tag;
+    uint32_t mask;
+  };
+
+  S2World world{S2_NULL_HANDLE};
+  TiRuntime runtime{TI_NULL_HANDLE};
+  // The number of cells along each axis of the binning grid used to find the
+  // triggers near a particle.
+  uint32_t bin_resolution{64};
+
+  // The maximum number of undrained events. When full, the oldest events are
+  // dropped and counted in `dropped_event_num_`.
+  uint32_t max_event_num{1024};
+
+  std::vector<Query> queries_{};
+  std::vector<uint32_t> particle_nums_{};
+  std::vector<uint32_t> previous_particle_nums_{};
+  std::deque<TriggerEvent> events_{};
+  uint32_t dropped_event_num_{0};
+
+  ParticleReadback readback_{};
+  std::vector<std::vector<uint32_t>> bins_{};
+
+  TriggerQueryBatch(){};
+  TriggerQueryBatch(S2World world, TiRuntime runtime)
+      : world(world), runtime(runtime),
+        readback_(runtime, world,
+                  {S2_BUFFER_NAME_PARTICLE_POSITION,
+                   S2_BUFFER_NAME_PARTICLE_TAG},
+                  {sizeof(S2Vec2), sizeof(uint32_t)}) {}
+
+  // Register a query and return its index into the results.
+  uint32_t Add(S2Trigger trigger, const S2Shape &shape, uint32_t tag = 0,
+               uint32_t mask = 0) {
+    Query query{trigger, shape, {}, tag, mask};
+    if (shape.type == S2_SHAPE_TYPE_POLYGON) {
+      const S2Vec2 *v = (const S2Vec2 *)shape.shape_union.polygon.vertices;
+      query.polygon_vertices.assign(v,
+                                    v + shape.shape_union.polygon.vertex_num);
+    }
+    queries_.push_back(std::move(query));
+    particle_nums_.push_back(0);
+    previous_particle_nums_.push_back(0);
+    return queries_.size() - 1;
+  }
+
+  void Destroy() { readback_.Destroy(); }
+
+  void Clear() {
+    queries_.clear();
+    particle_nums_.clear();
+    previous_particle_nums_.clear();
+    events_.clear();
+  }
+
+  // Read the live particles back with a single wait, update the results of
+  // all queries and queue an event for every query that became empty or
+  // non-empty. Should be called after `s2_step()`.
+  void Evaluate() {
+    Count();
+    for (uint32_t i = 0; i < queries_.size(); ++i) {
+      bool was_overlapped = previous_particle_nums_[i] != 0;
+      if (was_overlapped != IsOverlapped(i)) {
+        const Query &query = queries_[i];
+        PushEvent({i, query.trigger, query.tag, query.mask,
+                   was_overlapped ? TRIGGER_EVENT_TYPE_EXIT
+                                  : TRIGGER_EVENT_TYPE_ENTER,
+                   particle_nums_[i]});
+      }
+    }
+    previous_particle_nums_ = particle_nums_;
+  }
+
+  // Move up to `capacity` queued events, oldest first, into `events` and
+  // return the number of events moved.
+  uint32_t PollEvents(TriggerEvent *events, uint32_t capacity) {
+    uint32_t n = std::min<size_t>(capacity, events_.size());
+    std::copy(events_.begin(), events_.begin() + n, events);
+    events_.erase(events_.begin(), events_.begin() + n);
+    return n;
+  }
+
+  uint32_t GetDroppedEventNum() const { return dropped_event_num_; }
+
+  void PushEvent(const TriggerEvent &event) {
+    if (max_event_num == 0) {
+      ++dropped_event_num_;
+      return;
+    }
+    if (events_.size() == max_event_num) {
+      events_.pop_front();
+      ++dropped_event_num_;
+    }
+    events_.push_back(event);
+  }
+
+  void Count() {
+    std::fill(particle_nums_.begin(), particle_nums_.end(), 0);
+    if (queries_.empty()) {
+      return;
+    }
+    uint32_t n = readback_.Read();
+    if (n == 0) {
+      return;
+    }
+    const S2Vec2 *positions = (const S2Vec2 *)readback_.GetData(0);
+    const uint32_t *tags = (const uint32_t *)readback_.GetData(1);
+
+    // Group queries by trigger so that each trigger's shape is tested once per
+    // particle, and bin the triggers by their world-space bounding boxes.
+    std::unordered_map<S2Trigger, uint32_t> trigger_indices;
+    std::vector<std::vector<uint32_t>> trigger_queries;
+    std::vector<S2Vec2> centers;
+    std::vector<float> rotations;
+    std::vector<const S2Shape *> shapes;
+    for (uint32_t i = 0; i < queries_.size(); ++i) {
+      Query &query = queries_[i];
+      if (query.shape.type == S2_SHAPE_TYPE_POLYGON) {
+        query.shape.shape_union.polygon.vertices =
+            query.polygon_vertices.data();
+      }
+      auto it = trigger_indices.find(query.trigger);
+      if (it == trigger_indices.end()) {
+        it = trigger_indices.emplace(query.trigger, shapes.size()).first;
+        trigger_queries.emplace_back();
+        centers.push_back(s2_get_trigger_position(query.trigger));
+        rotations.push_back(s2_get_trigger_rotation(query.trigger));
+        shapes.push_back(&query.shape);
+      }
+      trigger_queries[it->second].push_back(i);
+    }
+
+    S2WorldConfig config = s2_get_world_config(world);
+    S2Vec2 cell_size = div(config.extent, bin_resolution);
+    // Keep the bins' storage between evaluations.
+    bins_.resize(bin_resolution * bin_resolution);
+    for (auto &bin : bins_) {
+      bin.clear();
+    }
+    auto to_cell = [&](float x, float lower, float size) {
+      int cell = (int)std::floor((x - lower) / size);
+      return std::clamp(cell, 0, (int)bin_resolution - 1);
+    };
+    for (uint32_t t = 0; t < shapes.size(); ++t) {
+      S2Vec2 lower;
+      S2Vec2 upper;
+      shape_world_aabb(*shapes[t], centers[t], rotations[t], lower, upper);
+      int x0 = to_cell(lower.x, config.offset.x, cell_size.x);
+      int x1 = to_cell(upper.x, config.offset.x, cell_size.x);
+      int y0 = to_cell(lower.y, config.offset.y, cell_size.y);
+      int y1 = to_cell(upper.y, config.offset.y, cell_size.y);
+      for (int y = y0; y <= y1; ++y) {
+        for (int x = x0; x <= x1; ++x) {
+          bins_[y * bin_resolution + x].push_back(t);
+        }
+      }
+    }
+
+    for (uint32_t i = 0; i < n; ++i) {
+      const S2Vec2 &p = positions[i];
+      int x = to_cell(p.x, config.offset.x, cell_size.x);
+      int y = to_cell(p.y, config.offset.y, cell_size.y);
+      for (uint32_t t : bins_[y * bin_resolution + x]) {
+        if (!point_in_shape(*shapes[t],
+                            to_local(p, centers[t], rotations[t]))) {
+          continue;
+        }
+        for (uint32_t q : trigger_queries[t]) {
+          if ((tags[i] & queries_[q].mask) == queries_[q].tag) {
+            ++particle_nums_[q];
+          }
+        }
+      }
+    }
+  }
+
+  uint32_t GetParticleNum(uint32_t index) const {
+    return particle_nums_[index];
+  }
+
+  bool IsOverlapped(uint32_t index) const {
+    return particle_nums_[index] != 0;
+  }
+
+  // The results of all queries, in registration order.
+  const std::vector<uint32_t> &GetParticleNums() const {
+    return particle_nums_;
+  }
+};
@@ -0,0 +1,18 @@
+// Compile-only use of the helper headers in examples/ that no example
+// includes, so that the test build catches breakage in them.
+
+// avoid clang-format disorders headers
+// clang-format off
+#include <taichi/taichi.h>
+#include <soft2d/soft2d.h>
+#include "common.h"
+#include "geometry.h"
+#include "particle_readback.h"
+#include "adaptive_substep.h"
+#include "async_step.h"
+#include "parallel_callback.h"
+#include "particle_kernel.h"
+#include "terrain.h"
+#include "trajectory_recorder.h"
+#include "trigger_query.h"
+// clang-format on
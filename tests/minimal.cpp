@@ -2,15 +2,51 @@
 // clang-format off
 #include <taichi/cpp/taichi.hpp>
 #include <soft2d/soft2d.h>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <string>
 // clang-format on
 
 using namespace std;
 
-int main() {
+// Defined in trajectory_recorder.cpp.
+bool test_trajectory_recorder_roundtrip();
 
-  // Create a runtime.
+// Parse the backend from a `--arch=<name>` argument. Vulkan is used by default.
+TiArch parse_arch(int argc, char **argv) {
   TiArch arch = TiArch::TI_ARCH_VULKAN;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strncmp(argv[i], "--arch=", 7) != 0) {
+      continue;
+    }
+    std::string name = argv[i] + 7;
+    if (name == "vulkan") {
+      arch = TiArch::TI_ARCH_VULKAN;
+    } else if (name == "x64") {
+      arch = TiArch::TI_ARCH_X64;
+    } else if (name == "arm64") {
+      arch = TiArch::TI_ARCH_ARM64;
+    } else if (name == "metal") {
+      arch = TiArch::TI_ARCH_METAL;
+    } else {
+      std::cerr << "Unknown arch: " << name << std::endl;
+      std::exit(1);
+    }
+  }
+  return arch;
+}
+
+int main(int argc, char **argv) {
+
+  // Run the host-only tests first.
+  if (!test_trajectory_recorder_roundtrip()) {
+    return 1;
+  }
+
+  // Create a runtime.
+  TiArch arch = parse_arch(argc, argv);
   ti::Runtime runtime(arch);
 
   // Specify the world configuration.
@@ -34,11 +70,24 @@ int main() {
   // Create a world.
   S2World world = s2_create_world(arch, runtime, &config);
 
-  // Simulate the world for 100 steps.
+  // Warm up first so that kernel loading and compilation are not timed.
   float time_step = 2e-3f;
+  for (int i = 0; i < 5; ++i) {
+    s2_step(world, time_step);
+  }
+  runtime.wait();
+
+  // Simulate the world for 100 steps.
+  auto begin = std::chrono::steady_clock::now();
   for (int i = 0; i < 100; ++i) {
     s2_step(world, time_step);
   }
+  runtime.wait();
+  auto end = std::chrono::steady_clock::now();
+  std::cout << "Average step time: "
+            << std::chrono::duration<double, std::milli>(end - begin).count() /
+                   100
+            << " ms" << std::endl;
 
   std::cout << "Soft2D runs successfully!" << std::endl;
   return 0;
@@ -0,0 +1,99 @@
+// avoid clang-format disorders headers
+// clang-format off
+#include <taichi/taichi.h>
+#include <soft2d/soft2d.h>
+#include "common.h"
+#include "particle_readback.h"
+#include "trajectory_recorder.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+// clang-format on
+
+// Record frames whose particle set changes over time, then decode every frame
+// back and check it against the recorded state within the quantization error.
+// Runs on the host only.
+bool test_trajectory_recorder_roundtrip() {
+  const char *path = "trajectory_recorder_test.s2rt";
+  const S2Vec2 offset = {-1.0f, 2.0f};
+  const S2Vec2 extent = {4.0f, 2.0f};
+  const float velocity_range = 8.0f;
+  const uint32_t frame_num = 11;
+
+  std::vector<TrajectoryFrame> frames(frame_num);
+  for (uint32_t f = 0; f < frame_num; ++f) {
+    // Particles with small ids are removed and new ones appended over time.
+    for (uint32_t id = f * 3; id < 100 + f * 5; ++id) {
+      float t = 0.1f * f + 0.01f * id;
+      frames[f].ids.push_back(id);
+      frames[f].positions.push_back(
+          vec2(offset.x + extent.x * (0.5f + 0.4f * std::sin(t)),
+               offset.y + extent.y * (0.5f + 0.4f * std::cos(t))));
+      frames[f].velocities.push_back(
+          vec2(velocity_range * std::cos(3.0f * t), -0.5f * id));
+    }
+  }
+
+  TrajectoryRecorder recorder;
+  if (recorder.Open(path, offset, extent, 0.0f)) {
+    std::cerr << "Trajectory recorder accepted a zero velocity range"
+              << std::endl;
+    return false;
+  }
+  if (recorder.Open(path, offset, extent, velocity_range, 0)) {
+    std::cerr << "Trajectory recorder accepted zero frames per chunk"
+              << std::endl;
+    return false;
+  }
+  if (!recorder.Open(path, offset, extent, velocity_range, 4)) {
+    std::cerr << "Failed to open " << path << std::endl;
+    return false;
+  }
+  for (auto &frame : frames) {
+    recorder.RecordFrame(frame);
+  }
+  if (!recorder.Close()) {
+    std::cerr << "Failed to write " << path << std::endl;
+    return false;
+  }
+
+  TrajectoryReader reader;
+  bool ok = reader.Open(path) && reader.GetFrameNum() == frame_num;
+  float position_error = extent.x / 65535.0f;
+  float velocity_error = 2.0f * velocity_range / 65535.0f;
+  // Decode in reverse so that every frame seeks to its own chunk.
+  for (uint32_t f = frame_num; ok && f-- > 0;) {
+    TrajectoryFrame decoded;
+    const TrajectoryFrame &expected = frames[f];
+    ok = reader.ReadFrame(f, decoded) && decoded.ids == expected.ids;
+    for (size_t i = 0; ok && i < expected.ids.size(); ++i) {
+      float vy = std::max(expected.velocities[i].y, -velocity_range);
+      ok = std::abs(decoded.positions[i].x - expected.positions[i].x) <=
+               position_error &&
+           std::abs(decoded.positions[i].y - expected.positions[i].y) <=
+               position_error &&
+           std::abs(decoded.velocities[i].x - expected.velocities[i].x) <=
+               velocity_error &&
+           std::abs(decoded.velocities[i].y - vy) <= velocity_error;
+    }
+  }
+  reader.Close();
+
+  // A frame number that does not match the chunk table must be rejected.
+  if (ok) {
+    std::FILE *file = std::fopen(path, "r+b");
+    uint32_t frame_num_override = 0xffffffffu;
+    ok = file != nullptr && std::fseek(file, -8, SEEK_END) == 0 &&
+         std::fwrite(&frame_num_override, sizeof(uint32_t), 1, file) == 1;
+    if (file != nullptr) {
+      ok = std::fclose(file) == 0 && ok;
+    }
+    ok = ok && !reader.Open(path);
+  }
+  std::remove(path);
+  if (!ok) {
+    std::cerr << "Trajectory roundtrip mismatch" << std::endl;
+  }
+  return ok;
+}